@@ -0,0 +1,64 @@
+#!/bin/bash
+
+# Checks that clients hanging up early only drop their own connection:
+# after each abort the server (one worker thread) must still answer.
+# Runs plaintext, TLS (kTLS when the kernel has it) and userspace TLS (-u).
+# Needs "make" and "make cert" first.
+
+# Variables
+port=8113
+big_file=abort.bin
+big_mb=64
+failures=0
+
+if [[ ! -f $big_file ]]; then
+  head -c $((big_mb * 1024 * 1024)) /dev/urandom > $big_file
+fi
+
+check() {
+  label=$1
+  url=$2
+  if curl -sk --max-time 5 -o /dev/null "$url/index.html" && kill -0 $server_pid 2> /dev/null; then
+    echo "PASS $label"
+  else
+    echo "FAIL $label"
+    failures=$((failures + 1))
+  fi
+}
+
+run_checks() {
+  mode=$1
+  url=$2
+  shift 2
+
+  ./wserver -p $port -t 1 -b 2 "$@" > /dev/null 2>&1 &
+  server_pid=$!
+  sleep 0.5
+
+  # Hang up in the middle of a large static response
+  curl -sk --limit-rate 100k --max-time 2 -o /dev/null "$url/$big_file"
+  check "$mode: abort mid-response" "$url"
+
+  # Connect and hang up before sending a request line
+  bash -c "exec 3<>/dev/tcp/127.0.0.1/$port; exec 3>&-"
+  check "$mode: close before request" "$url"
+
+  if [[ $url == https* ]]; then
+    # Finish the handshake, then send close_notify instead of a request
+    openssl s_client -connect 127.0.0.1:$port -quiet -no_ign_eof < /dev/null > /dev/null 2>&1
+    check "$mode: close_notify before request" "$url"
+  fi
+
+  kill $server_pid
+  wait $server_pid 2> /dev/null
+}
+
+run_checks "plaintext" "http://127.0.0.1:$port"
+run_checks "TLS" "https://127.0.0.1:$port" -c server.crt -k server.key
+run_checks "userspace TLS" "https://127.0.0.1:$port" -c server.crt -k server.key -u
+
+if ! grep -qw tls /proc/sys/net/ipv4/tcp_available_ulp 2> /dev/null; then
+  echo "note: kernel TLS ULP not available, the TLS run used the userspace path"
+fi
+
+exit $failures
@@ -1,17 +1,23 @@
 #include "io_helper.h"
 
+// Returns the number of bytes stored (0 at EOF), or -1 on error
 ssize_t readline(int fd, void *buf, size_t maxlen) {
     char c;
     char *bufp = buf;
     int n;
     for (n = 0; n < maxlen - 1; n++) { // leave room at end for '\0'
-	int rc;
-        if ((rc = read_or_die(fd, &c, 1)) == 1) {
+	ssize_t rc;
+        do {
+            rc = read(fd, &c, 1);
+        } while (rc < 0 && errno == EINTR);
+        if (rc == 1) {
             *bufp++ = c;
-            if (c == '\n')
+            if (c == '\n') {
+                n++;
                 break;
+            }
         } else if (rc == 0) {
-            if (n == 1)
+            if (n == 0)
                 return 0; /* EOF, no data read */
             else
                 break;    /* EOF, some data was read */
@@ -22,6 +28,24 @@ ssize_t readline(int fd, void *buf, size_t maxlen) {
     return n;
 }
 
+// Writes all of buf, unlike a bare write() that may stop short;
+// returns -1 if the peer went away
+ssize_t writen(int fd, void *buf, size_t n) {
+    char *bufp = buf;
+    size_t left = n;
+    while (left > 0) {
+        ssize_t rc = write(fd, bufp, left);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        bufp += rc;
+        left -= rc;
+    }
+    return n;
+}
+
 
 int open_client_fd(char *hostname, int port) {
     int client_fd;
@@ -15,6 +15,7 @@
 #include <string.h>
 #include <strings.h>
 #include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -81,6 +82,7 @@ typedef struct sockaddr sockaddr_t;
 
 // client/server helper functions 
 ssize_t readline(int fd, void *buf, size_t maxlen);
+ssize_t writen(int fd, void *buf, size_t n);
 int open_client_fd(char *hostname, int portno);
 int open_listen_fd(int portno);
 
@@ -0,0 +1,55 @@
+#!/bin/bash
+
+# Drives the traced build (wserver-prof) with wclient and reports where the
+# time goes: per-phase latencies from the built-in tracepoints and, when
+# perf is installed, folded stacks ready for flamegraph.pl.
+# Run through "make profile". Results land in profile_out/.
+
+# Variables
+port=8112
+threads=8
+buffers=16
+clients=20
+num_runs=200
+out_dir=profile_out
+
+mkdir -p $out_dir
+rm -f $out_dir/*
+
+WSERVER_TRACE_FILE=$out_dir/events.txt ./wserver-prof -p $port -t $threads -b $buffers \
+  > /dev/null 2> $out_dir/phases.txt &
+server_pid=$!
+sleep 0.5
+
+if command -v perf > /dev/null; then
+  perf record -F 999 -g -p $server_pid -o $out_dir/perf.data > /dev/null 2>&1 &
+  perf_pid=$!
+else
+  echo "perf not found: skipping folded stacks"
+fi
+
+# Loop to drive static and CGI requests
+for i in $(seq 1 $num_runs)
+do
+  ./wclient 127.0.0.1 $port /index.html $clients > /dev/null
+  ./wclient 127.0.0.1 $port "/spin.cgi?0" $clients > /dev/null
+done
+
+if [[ -n $perf_pid ]]; then
+  kill -INT $perf_pid
+  wait $perf_pid
+  # Collapse each sampled stack into "comm;root;...;leaf count"
+  perf script -i $out_dir/perf.data 2> /dev/null | awk '
+    /^[^ \t]/ { comm = $1; stack = ""; next }
+    /^[ \t]*$/ { if (stack != "") counts[comm ";" stack]++; stack = ""; next }
+    { f = $2; sub(/\+0x[0-9a-f]+$/, "", f); stack = (stack == "" ? f : f ";" stack) }
+    END { for (s in counts) print s, counts[s] }' > $out_dir/stacks.folded
+  echo "folded stacks: $out_dir/stacks.folded"
+fi
+
+# SIGTERM makes the traced server print its per-phase summary
+kill -TERM $server_pid
+wait $server_pid
+
+cat $out_dir/phases.txt
+echo "raw phase events: $out_dir/events.txt"
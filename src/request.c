@@ -1,5 +1,6 @@
 #include "io_helper.h"
 #include "request.h"
+#include "trace.h"
 
 //
 // Some of this code stolen from Bryant/O'Halloran
@@ -8,6 +9,13 @@
 
 #define MAXBUF (8192)
 
+//
+// I/O on the client connection is allowed to fail: the client may hang up
+// at any time (and with kTLS, read() fails with EIO when the next record
+// is an alert such as close_notify).  Such errors only drop the
+// connection; the *_or_die wrappers are kept for local resources.
+//
+
 void request_error(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg) {
     char buf[MAXBUF], body[MAXBUF];
     
@@ -25,29 +33,33 @@ void request_error(int fd, char *cause, char *errnum, char *shortmsg, char *long
     
     // Write out the header information for this response
     sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-    write_or_die(fd, buf, strlen(buf));
+    if (writen(fd, buf, strlen(buf)) < 0)
+	return;
     
     sprintf(buf, "Content-Type: text/html\r\n");
-    write_or_die(fd, buf, strlen(buf));
+    if (writen(fd, buf, strlen(buf)) < 0)
+	return;
     
     sprintf(buf, "Content-Length: %lu\r\n\r\n", strlen(body));
-    write_or_die(fd, buf, strlen(buf));
+    if (writen(fd, buf, strlen(buf)) < 0)
+	return;
     
     // Write out the body last
-    write_or_die(fd, body, strlen(body));
+    writen(fd, body, strlen(body));
 }
 
 //
 // Reads and discards everything up to an empty text line
+// Returns -1 if the connection ends first
 //
-void request_read_headers(int fd) {
+int request_read_headers(int fd) {
     char buf[MAXBUF];
     
-    readline_or_die(fd, buf, MAXBUF);
-    while (strcmp(buf, "\r\n")) {
-	readline_or_die(fd, buf, MAXBUF);
-    }
-    return;
+    do {
+	if (readline(fd, buf, MAXBUF) <= 0)
+	    return -1;
+    } while (strcmp(buf, "\r\n"));
+    return 0;
 }
 
 //
@@ -102,31 +114,36 @@ void request_serve_dynamic(int fd, char *filename, char *cgiargs) {
 	    "HTTP/1.0 200 OK\r\n"
 	    "Server: OSTEP WebServer\r\n");
     
-    write_or_die(fd, buf, strlen(buf));
+    if (writen(fd, buf, strlen(buf)) < 0)
+	return;
     
+    TRACE_BEGIN(t_fork);
     if (fork_or_die() == 0) {                        // child
 	setenv_or_die("QUERY_STRING", cgiargs, 1);   // args to cgi go here
+	signal(SIGPIPE, SIG_DFL);                    // the server ignores it, the cgi should not
+	trace_child_reset();                         // undo the tracer's blocked signals
 	dup2_or_die(fd, STDOUT_FILENO);              // make cgi writes go to socket (not screen)
 	extern char **environ;                       // defined by libc 
 	execve_or_die(filename, argv, environ);
     } else {
+	TRACE_END(TRACE_CGI_FORK, t_fork);
+	TRACE_BEGIN(t_wait);
 	wait_or_die(NULL);
+	TRACE_END(TRACE_CGI_WAIT, t_wait);
     }
 }
 
 void request_serve_static(int fd, char *filename, int filesize) {
     int srcfd;
-    char *srcp, filetype[MAXBUF], buf[MAXBUF];
+    char filetype[MAXBUF], buf[MAXBUF];
     
+    TRACE_BEGIN(t_open);
     request_get_filetype(filename, filetype);
     srcfd = open_or_die(filename, O_RDONLY, 0);
-    
-    // Rather than call read() to read the file into memory, 
-    // which would require that we allocate a buffer, we memory-map the file
-    srcp = mmap_or_die(0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0);
-    close_or_die(srcfd);
+    TRACE_END(TRACE_STATIC_OPEN, t_open);
     
     // put together response
+    TRACE_BEGIN(t_header);
     sprintf(buf, ""
 	    "HTTP/1.0 200 OK\r\n"
 	    "Server: OSTEP WebServer\r\n"
@@ -134,11 +151,26 @@ void request_serve_static(int fd, char *filename, int filesize) {
 	    "Content-Type: %s\r\n\r\n", 
 	    filesize, filetype);
     
-    write_or_die(fd, buf, strlen(buf));
-    
-    //  Writes out to the client socket the memory-mapped file 
-    write_or_die(fd, srcp, filesize);
-    munmap_or_die(srcp, filesize);
+    if (writen(fd, buf, strlen(buf)) < 0) {
+	close_or_die(srcfd);
+	return;
+    }
+    TRACE_END(TRACE_STATIC_HEADER, t_header);
+    
+    // Rather than mapping the file and write()-ing it, let the kernel copy
+    // it straight from the page cache to the socket (encrypting it on the
+    // way out when kTLS is active)
+    TRACE_BEGIN(t_send);
+    off_t offset = 0;
+    while (offset < filesize) {
+	ssize_t rc = sendfile(fd, srcfd, &offset, filesize - offset);
+	if (rc < 0 && errno == EINTR)
+	    continue;
+	if (rc <= 0)
+	    break; // client went away, or file shrank underneath us
+    }
+    TRACE_END(TRACE_STATIC_SENDFILE, t_send);
+    close_or_die(srcfd);
 }
 
 // handle a request
@@ -148,7 +180,10 @@ void request_handle(int fd) {
     char buf[MAXBUF], method[MAXBUF], uri[MAXBUF], version[MAXBUF];
     char filename[MAXBUF], cgiargs[MAXBUF];
     
-    readline_or_die(fd, buf, MAXBUF);
+    TRACE_BEGIN(t_request);
+    TRACE_BEGIN(t_parse);
+    if (readline(fd, buf, MAXBUF) <= 0)
+	return;
     sscanf(buf, "%s %s %s", method, uri, version);
     printf("method:%s uri:%s version:%s\n", method, uri, version);
     
@@ -156,10 +191,16 @@ void request_handle(int fd) {
 	request_error(fd, method, "501", "Not Implemented", "server does not implement this method");
 	return;
     }
-    request_read_headers(fd);
+    if (request_read_headers(fd) < 0)
+	return;
     
     is_static = request_parse_uri(uri, filename, cgiargs);
-    if (stat(filename, &sbuf) < 0) {
+    TRACE_END(TRACE_PARSE, t_parse);
+    
+    TRACE_BEGIN(t_stat);
+    int rc = stat(filename, &sbuf);
+    TRACE_END(TRACE_STAT, t_stat);
+    if (rc < 0) {
 	request_error(fd, filename, "404", "Not found", "server could not find this file");
 	return;
     }
@@ -177,4 +218,5 @@ void request_handle(int fd) {
 	}
 	request_serve_dynamic(fd, filename, cgiargs);
     }
+    TRACE_END(TRACE_REQUEST, t_request);
 }
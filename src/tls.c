@@ -0,0 +1,184 @@
+#include "io_helper.h"
+#include "tls.h"
+
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <openssl/err.h>
+
+//
+// HTTPS support on top of OpenSSL.  With SSL_OP_ENABLE_KTLS, OpenSSL sets
+// TCP_ULP "tls" on the socket once the handshake is done and hands the
+// negotiated keys to the kernel, which then does the record layer for
+// plain read()/write()/sendfile() on the socket.
+//
+
+#define MAXBUF (8192)
+#define TLS_SESSION_CACHE_SIZE (20480)
+#define TLS_SESSION_TIMEOUT (300)  // seconds
+
+// AEAD suites the kernel TLS module implements
+#define TLS_CIPHERS "ECDHE+AESGCM:ECDHE+CHACHA20"
+
+static SSL_CTX *tls_ctx = NULL;
+
+int tls_init(char *cert_file, char *key_file, int use_ktls) {
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if (ctx == NULL) {
+	ERR_print_errors_fp(stderr);
+	return -1;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_cipher_list(ctx, TLS_CIPHERS);
+    if (use_ktls) {
+	SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+	// OpenSSL 3.0 only offloads the transmit side of TLS 1.3; stay on
+	// TLS 1.2 so that receive moves into the kernel as well
+	SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+    }
+
+    // Resumption: stateless session tickets (on by default, keys are
+    // generated per context), plus a server-side session cache for
+    // clients that only do session-id resumption
+    SSL_CTX_set_session_id_context(ctx, (const unsigned char *) "wserver", 7);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, TLS_SESSION_CACHE_SIZE);
+    SSL_CTX_set_timeout(ctx, TLS_SESSION_TIMEOUT);
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert_file) <= 0 ||
+	SSL_CTX_use_PrivateKey_file(ctx, key_file, SSL_FILETYPE_PEM) <= 0 ||
+	!SSL_CTX_check_private_key(ctx)) {
+	fprintf(stderr, "could not load certificate %s / key %s\n", cert_file, key_file);
+	ERR_print_errors_fp(stderr);
+	SSL_CTX_free(ctx);
+	return -1;
+    }
+
+    tls_ctx = ctx;
+    return 0;
+}
+
+static int write_all(int fd, char *buf, int len) {
+    while (len > 0) {
+	ssize_t rc = write(fd, buf, len);
+	if (rc < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+	buf += rc;
+	len -= rc;
+    }
+    return 0;
+}
+
+//
+// Userspace fallback: moves plaintext between the worker's end of the
+// socketpair and the TLS connection until the worker closes its end or
+// the client goes away
+//
+static void *tls_relay(void *arg) {
+    tls_conn_t *c = (tls_conn_t *) arg;
+    char buf[MAXBUF];
+    struct pollfd fds[2];
+    int client_open = 1;
+
+    fds[0].fd = c->conn_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = c->relay_fd;
+    fds[1].events = POLLIN;
+    while (1) {
+	// records already decrypted by OpenSSL will not wake up poll()
+	int pending = client_open && SSL_pending(c->ssl) > 0;
+	fds[0].revents = fds[1].revents = 0;
+	if (!pending && poll(fds, 2, -1) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+
+	if (pending || fds[0].revents) {
+	    int n = SSL_read(c->ssl, buf, sizeof(buf));
+	    if (n > 0) {
+		if (write_all(c->relay_fd, buf, n) < 0)
+		    break;
+	    } else {
+		// client closed or failed: signal EOF to the worker, but
+		// keep draining the response it may still be writing
+		client_open = 0;
+		fds[0].fd = -1;
+		shutdown(c->relay_fd, SHUT_WR);
+	    }
+	}
+
+	if (fds[1].revents) {
+	    ssize_t n = read(c->relay_fd, buf, sizeof(buf));
+	    if (n <= 0)
+		break;    // worker is done with this connection
+	    if (SSL_write(c->ssl, buf, n) <= 0)
+		break;
+	}
+    }
+    // Nobody drains the socketpair any more: make the worker's pending and
+    // future reads/writes on c->fd fail instead of blocking forever
+    shutdown(c->relay_fd, SHUT_RDWR);
+    return NULL;
+}
+
+int tls_accept(tls_conn_t *c, int conn_fd) {
+    c->conn_fd = conn_fd;
+    c->fd = -1;
+    c->relay_fd = -1;
+
+    // The handshake is several small writes per flight; with Nagle on, the
+    // last one waits for the client's delayed ACK
+    int optval = 1;
+    setsockopt(conn_fd, IPPROTO_TCP, TCP_NODELAY, (const void *) &optval, sizeof(int));
+
+    c->ssl = SSL_new(tls_ctx);
+    if (c->ssl == NULL || SSL_set_fd(c->ssl, conn_fd) != 1) {
+	ERR_print_errors_fp(stderr);
+	SSL_free(c->ssl);
+	return -1;
+    }
+    if (SSL_accept(c->ssl) <= 0) {
+	fprintf(stderr, "TLS handshake failed on connection %d\n", conn_fd);
+	ERR_print_errors_fp(stderr);
+	SSL_free(c->ssl);
+	return -1;
+    }
+
+    if (BIO_get_ktls_send(SSL_get_wbio(c->ssl)) && BIO_get_ktls_recv(SSL_get_rbio(c->ssl))) {
+	// kernel owns the record layer in both directions
+	c->fd = conn_fd;
+	return 0;
+    }
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+	fprintf(stderr, "socketpair() failed\n");
+	SSL_free(c->ssl);
+	return -1;
+    }
+    c->fd = sv[0];
+    c->relay_fd = sv[1];
+    if (pthread_create(&c->relay, NULL, tls_relay, (void *) c) != 0) {
+	fprintf(stderr, "Error creating TLS relay thread\n");
+	close_or_die(sv[0]);
+	close_or_die(sv[1]);
+	SSL_free(c->ssl);
+	return -1;
+    }
+    return 0;
+}
+
+// Flushes and tears down the connection, including the client socket
+void tls_close(tls_conn_t *c) {
+    if (c->relay_fd >= 0) {
+	close_or_die(c->fd);
+	pthread_join(c->relay, NULL);
+	close_or_die(c->relay_fd);
+    }
+    SSL_shutdown(c->ssl);
+    SSL_free(c->ssl);
+    close_or_die(c->conn_fd);
+}
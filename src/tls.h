@@ -0,0 +1,25 @@
+#ifndef __TLS_H__
+#define __TLS_H__
+
+#include <pthread.h>
+#include <openssl/ssl.h>
+
+// Per-connection TLS state. 'fd' is what request_handle() should use:
+// with kTLS it is the client socket itself (the kernel does the record
+// layer, so read/write/sendfile work unchanged); otherwise it is one end
+// of a socketpair that a relay thread pumps through SSL_read/SSL_write.
+typedef struct {
+    SSL *ssl;
+    int conn_fd;     // socket to the client
+    int fd;          // descriptor handed to request_handle()
+    int relay_fd;    // relay end of the socketpair, -1 with kTLS
+    pthread_t relay;
+} tls_conn_t;
+
+// use_ktls = 0 forces userspace TLS (useful for benchmarking)
+int tls_init(char *cert_file, char *key_file, int use_ktls);
+// on failure the caller still owns conn_fd
+int tls_accept(tls_conn_t *c, int conn_fd);
+void tls_close(tls_conn_t *c);
+
+#endif // __TLS_H__
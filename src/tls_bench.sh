@@ -0,0 +1,58 @@
+#!/bin/bash
+
+# Compares kTLS against userspace TLS: handshake rate (full and resumed)
+# with openssl s_time, and bulk throughput of a large static file with curl.
+# Needs "make" and "make cert" first. Both runs are pinned to TLS 1.2 so
+# they negotiate the same protocol and cipher.
+
+# Variables
+port=8443
+threads=8
+buffers=16
+seconds=10
+bulk_file=bench.bin
+bulk_mb=256
+num_runs=20
+
+# Create the bulk file once
+if [[ ! -f $bulk_file ]]; then
+  head -c $((bulk_mb * 1024 * 1024)) /dev/urandom > $bulk_file
+fi
+
+run_bench() {
+  label=$1
+  shift
+
+  ./wserver -p $port -t $threads -b $buffers -c server.crt -k server.key "$@" > /dev/null 2>&1 &
+  server_pid=$!
+  sleep 0.5
+
+  echo "== $label =="
+
+  # Handshake rate: new sessions, then resumed ones
+  for mode in -new -reuse; do
+    result=$(openssl s_time -connect 127.0.0.1:$port -tls1_2 $mode -time $seconds -www /index.html 2>/dev/null \
+             | grep -E 'connections/user sec' | tail -n 1)
+    echo "handshake $mode: $result"
+  done
+
+  # Bulk throughput, averaged over num_runs downloads
+  total_speed=0
+  for i in $(seq 1 $num_runs)
+  do
+    speed=$(curl -sk --tls-max 1.2 -o /dev/null -w '%{speed_download}' https://127.0.0.1:$port/$bulk_file)
+    total_speed=$(echo "$total_speed + $speed" | bc)
+  done
+  average_speed=$(echo "scale=2; $total_speed / $num_runs / 1048576" | bc)
+  echo "bulk: $average_speed MB/s over $num_runs runs of $bulk_mb MB"
+
+  kill $server_pid
+  wait $server_pid 2>/dev/null
+}
+
+if ! grep -qw tls /proc/sys/net/ipv4/tcp_available_ulp 2>/dev/null; then
+  echo "warning: kernel TLS ULP not available (modprobe tls); the kTLS run will fall back to userspace"
+fi
+
+run_bench "kTLS"
+run_bench "userspace TLS" -u
@@ -0,0 +1,198 @@
+#include "io_helper.h"
+#include "trace.h"
+
+#ifdef WSERVER_TRACE
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE_PROBE(p, c) STAP_PROBE2(wserver, phase, p, c)
+#else
+#define TRACE_PROBE(p, c) do { } while (0)
+#endif
+
+#define TRACE_RING_SIZE (4096)   // most recent events kept per thread
+#define TRACE_BUCKETS (64)       // log2(cycles) histogram
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    trace_phase_t phase;
+} trace_event_t;
+
+typedef struct {
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+    uint64_t hist[TRACE_BUCKETS];
+} trace_stats_t;
+
+typedef struct trace_thread {
+    pthread_t tid;
+    uint64_t head;
+    trace_event_t ring[TRACE_RING_SIZE];
+    trace_stats_t stats[TRACE_NPHASES];
+    struct trace_thread *next;
+} trace_thread_t;
+
+static char *phase_names[TRACE_NPHASES] = {
+    "request", "parse", "stat", "static_open", "static_header",
+    "static_sendfile", "cgi_fork", "cgi_wait", "buffer_push",
+    "buffer_pop", "tls_handshake",
+};
+
+static __thread trace_thread_t *self = NULL;
+static trace_thread_t *threads = NULL;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static double cycles_per_us = 1.0;
+static FILE *events_out = NULL;
+
+void trace_record(trace_phase_t phase, uint64_t start, uint64_t end) {
+    if (self == NULL) {
+	self = calloc(1, sizeof(trace_thread_t));
+	assert(self != NULL);
+	self->tid = pthread_self();
+	pthread_mutex_lock(&threads_lock);
+	self->next = threads;
+	threads = self;
+	pthread_mutex_unlock(&threads_lock);
+    }
+    uint64_t cycles = end - start;
+    TRACE_PROBE(phase, cycles);
+
+    trace_event_t *e = &self->ring[self->head++ % TRACE_RING_SIZE];
+    e->start = start;
+    e->end = end;
+    e->phase = phase;
+
+    trace_stats_t *s = &self->stats[phase];
+    s->count++;
+    s->total += cycles;
+    if (cycles > s->max)
+	s->max = cycles;
+    s->hist[cycles ? 63 - __builtin_clzll(cycles) : 0]++;
+}
+
+//
+// Estimate (in cycles) of the given quantile: find the log2 bucket that
+// holds it and interpolate linearly inside the bucket, whose top is
+// clamped to the observed max
+//
+static double trace_quantile(trace_stats_t *s, double q) {
+    uint64_t target = (uint64_t) (q * s->count), seen = 0;
+    for (int b = 0; b < TRACE_BUCKETS; b++) {
+	if (seen + s->hist[b] > target) {
+	    double lo = b ? (double) (1ULL << b) : 0.0;
+	    double hi = b == 63 ? (double) s->max : (double) ((2ULL << b) - 1);
+	    if (hi > s->max)
+		hi = s->max;
+	    return lo + (hi - lo) * (target - seen + 0.5) / s->hist[b];
+	}
+	seen += s->hist[b];
+    }
+    return s->max;
+}
+
+//
+// Called from the signal thread at shutdown; workers may still be running,
+// so the numbers are a best-effort snapshot
+//
+static void trace_dump(void) {
+    trace_stats_t total[TRACE_NPHASES];
+    memset(total, 0, sizeof(total));
+
+    pthread_mutex_lock(&threads_lock);
+    for (trace_thread_t *t = threads; t != NULL; t = t->next) {
+	for (int p = 0; p < TRACE_NPHASES; p++) {
+	    total[p].count += t->stats[p].count;
+	    total[p].total += t->stats[p].total;
+	    if (t->stats[p].max > total[p].max)
+		total[p].max = t->stats[p].max;
+	    for (int b = 0; b < TRACE_BUCKETS; b++)
+		total[p].hist[b] += t->stats[p].hist[b];
+	}
+	if (events_out != NULL) {
+	    uint64_t first = t->head > TRACE_RING_SIZE ? t->head - TRACE_RING_SIZE : 0;
+	    for (uint64_t i = first; i < t->head; i++) {
+		trace_event_t *e = &t->ring[i % TRACE_RING_SIZE];
+		fprintf(events_out, "%lu %s %" PRIu64 " %" PRIu64 "\n", (unsigned long) t->tid,
+			phase_names[e->phase], e->start, e->end);
+	    }
+	}
+    }
+    pthread_mutex_unlock(&threads_lock);
+    if (events_out != NULL)
+	fclose(events_out);
+
+    // p50/p99 are interpolated from log2 buckets, so they are estimates
+    fprintf(stderr, "%-16s %10s %12s %12s %12s %12s\n",
+	    "phase", "count", "mean(us)", "~p50(us)", "~p99(us)", "max(us)");
+    for (int p = 0; p < TRACE_NPHASES; p++) {
+	trace_stats_t *s = &total[p];
+	if (s->count == 0)
+	    continue;
+	fprintf(stderr, "%-16s %10" PRIu64 " %12.2f %12.2f %12.2f %12.2f\n",
+		phase_names[p], s->count,
+		s->total / (double) s->count / cycles_per_us,
+		trace_quantile(s, 0.50) / cycles_per_us,
+		trace_quantile(s, 0.99) / cycles_per_us,
+		s->max / cycles_per_us);
+    }
+}
+
+static sigset_t trace_signals;
+
+static void *trace_signal_thread(void *arg) {
+    sigset_t *set = (sigset_t *) arg;
+    int sig;
+    sigwait(set, &sig);
+    trace_dump();
+    exit(0);
+}
+
+static double trace_calibrate(void) {
+    struct timespec start, end, pause = { 0, 20 * 1000 * 1000 };
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t c0 = trace_now();
+    nanosleep(&pause, NULL);
+    uint64_t c1 = trace_now();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double us = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+    return (c1 - c0) / us;
+}
+
+//
+// Must run before any other thread is created: SIGINT/SIGTERM get blocked
+// here (and so in every thread created later) and are picked up by a
+// dedicated thread that prints the summary and exits.
+// Set WSERVER_TRACE_FILE to also get the raw ring events, one per line:
+// "thread phase start_tsc end_tsc".
+//
+void trace_init(void) {
+    pthread_t tid;
+
+    cycles_per_us = trace_calibrate();
+    char *path = getenv("WSERVER_TRACE_FILE");
+    if (path != NULL && *path != '\0' && (events_out = fopen(path, "w")) == NULL)
+	fprintf(stderr, "could not open %s\n", path);
+
+    sigemptyset(&trace_signals);
+    sigaddset(&trace_signals, SIGINT);
+    sigaddset(&trace_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &trace_signals, NULL);
+    if (pthread_create(&tid, NULL, trace_signal_thread, (void *) &trace_signals) != 0) {
+	fprintf(stderr, "Error creating trace thread\n");
+	exit(EXIT_FAILURE);
+    }
+}
+
+// The blocked mask survives fork+execve: unblock in CGI children so they
+// can still be interrupted or terminated
+void trace_child_reset(void) {
+    pthread_sigmask(SIG_UNBLOCK, &trace_signals, NULL);
+}
+
+#endif // WSERVER_TRACE
@@ -0,0 +1,61 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+//
+// Optional per-phase tracing, compiled in with -DWSERVER_TRACE (see
+// "make profile").  Each TRACE_BEGIN/TRACE_END pair stamps the phase with
+// the TSC into a per-thread ring and a per-thread latency histogram; the
+// summary is printed to stderr when the server gets SIGINT or SIGTERM.
+// If <sys/sdt.h> is available, every phase also fires the USDT probe
+// wserver:phase(phase, cycles) for perf/bpftrace.
+// Without WSERVER_TRACE all of this compiles to nothing.
+//
+
+#include <stdint.h>
+
+typedef enum {
+    TRACE_REQUEST,          // whole request_handle(), served requests only
+    TRACE_PARSE,            // request line, headers, uri
+    TRACE_STAT,
+    TRACE_STATIC_OPEN,
+    TRACE_STATIC_HEADER,
+    TRACE_STATIC_SENDFILE,
+    TRACE_CGI_FORK,
+    TRACE_CGI_WAIT,
+    TRACE_BUFFER_PUSH,      // includes waiting for a free slot
+    TRACE_BUFFER_POP,       // includes waiting for a connection
+    TRACE_TLS_HANDSHAKE,
+    TRACE_NPHASES
+} trace_phase_t;
+
+#ifdef WSERVER_TRACE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define trace_now() ((uint64_t) __rdtsc())
+#else
+#include <time.h>
+static inline uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+void trace_init(void);
+void trace_child_reset(void);
+void trace_record(trace_phase_t phase, uint64_t start, uint64_t end);
+
+#define TRACE_BEGIN(var) uint64_t var = trace_now()
+#define TRACE_END(phase, var) trace_record(phase, var, trace_now())
+
+#else
+
+#define trace_init() do { } while (0)
+#define trace_child_reset() do { } while (0)
+#define TRACE_BEGIN(var) do { } while (0)
+#define TRACE_END(phase, var) do { } while (0)
+
+#endif // WSERVER_TRACE
+
+#endif // __TRACE_H__
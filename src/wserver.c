@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include "request.h"
 #include "io_helper.h"
+#include "tls.h"
+#include "trace.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -15,6 +17,7 @@
 #define DEFAULT_BUFFERS 1
 #define BUFFER_SIZE 1024
 char default_root[] = ".";
+int tls_enabled = 0;
 
 typedef struct {
     int *buffer;
@@ -39,6 +42,7 @@ Buffer *buffer_init(int size) {
 }
 
 void buffer_push(Buffer *b, int conn_fd) {
+    TRACE_BEGIN(t_push);
     pthread_mutex_lock(&b->lock);
     while ((b->end + 1) % b->size == b->start) {
         printf("Buffer full, waiting space...\n");
@@ -49,9 +53,11 @@ void buffer_push(Buffer *b, int conn_fd) {
     printf("Connection %d added to the buffer (start: %d, end: %d)\n", conn_fd, b->start, b->end);
     pthread_cond_signal(&b->not_empty);
     pthread_mutex_unlock(&b->lock);
+    TRACE_END(TRACE_BUFFER_PUSH, t_push);
 }
 
 int buffer_pop(Buffer *b) {
+    TRACE_BEGIN(t_pop);
     pthread_mutex_lock(&b->lock);
     while (b->start == b->end) {
         printf("Buffer empty, waiting for a new connection...\n");
@@ -62,6 +68,7 @@ int buffer_pop(Buffer *b) {
     printf("Connection %d removed from the buffer (start: %d, end: %d)\n", conn_fd, b->start, b->end);
     pthread_cond_signal(&b->not_full);
     pthread_mutex_unlock(&b->lock);
+    TRACE_END(TRACE_BUFFER_POP, t_pop);
     return conn_fd;
 }
 
@@ -72,9 +79,21 @@ void *worker(void *arg) {
     while (1) {
         int conn_fd = buffer_pop(b);
         printf("Thread %ld processing connection %d.\n", pthread_self(), conn_fd);
-        request_handle(conn_fd);
+        if (tls_enabled) {
+            tls_conn_t tc;
+            TRACE_BEGIN(t_handshake);
+            if (tls_accept(&tc, conn_fd) < 0) {
+                close_or_die(conn_fd);
+                continue;
+            }
+            TRACE_END(TRACE_TLS_HANDSHAKE, t_handshake);
+            request_handle(tc.fd);
+            tls_close(&tc);
+        } else {
+            request_handle(conn_fd);
+            close_or_die(conn_fd);
+        }
         printf("Thread %ld finished processing connection %d.\n", pthread_self(), conn_fd);
-        close_or_die(conn_fd);
     }
 }
 
@@ -84,8 +103,11 @@ int main(int argc, char *argv[]) {
     int port = DEFAULT_PORT;
     int thread_count = DEFAULT_THREADS;
     int buffer_size = DEFAULT_BUFFERS;
+    char *cert_file = NULL;
+    char *key_file = NULL;
+    int use_ktls = 1;
 
-    while ((c = getopt(argc, argv, "d:p:t:b:")) != -1) {
+    while ((c = getopt(argc, argv, "d:p:t:b:c:k:u")) != -1) {
         switch (c) {
         case 'd':
             root_dir = optarg;
@@ -111,12 +133,39 @@ int main(int argc, char *argv[]) {
                 exit(EXIT_FAILURE);
             }
             break;
+        case 'c':
+            cert_file = optarg;
+            break;
+        case 'k':
+            key_file = optarg;
+            break;
+        case 'u':
+            use_ktls = 0;
+            break;
         default:
-            fprintf(stderr, "Usage: wserver [-d basedir] [-p port] [-t threads] [-b buffer_size]\n");
+            fprintf(stderr, "Usage: wserver [-d basedir] [-p port] [-t threads] [-b buffer_size] [-c cert -k key [-u]]\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Load the certificate before leaving the invocation directory
+    if (cert_file != NULL || key_file != NULL) {
+        if (cert_file == NULL || key_file == NULL) {
+            fprintf(stderr, "TLS needs both a certificate (-c) and a key (-k).\n");
             exit(EXIT_FAILURE);
         }
+        if (tls_init(cert_file, key_file, use_ktls) < 0)
+            exit(EXIT_FAILURE);
+        tls_enabled = 1;
     }
 
+    // Before any thread exists and before leaving the invocation directory
+    trace_init();
+
+    // A client that goes away mid-response only fails that request's
+    // writes (EPIPE) instead of killing the whole server
+    signal(SIGPIPE, SIG_IGN);
+
     // Change working directory
     chdir_or_die(root_dir);
 